@@ -0,0 +1,251 @@
+/*
+ *  Shared thread-pool for parallel work within BpoModes subcommands
+ *  RW Penney, May 2024
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#ifdef __linux__
+#  include <pthread.h>
+#  include <sched.h>
+#endif
+#include "bpoexecutor.hpp"
+
+
+namespace {
+  // Identification of the worker thread (if any) that is currently running:
+  thread_local const BpoExecutor* current_owner = nullptr;
+  thread_local unsigned current_index = 0;
+}
+
+
+/** Book-keeping for the tasks generated by a single call to parallel_for() */
+struct BpoExecutor::Batch {
+  std::size_t remaining;
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::exception_ptr error;
+};
+
+
+BpoExecutor::BpoExecutor()
+  : BpoExecutor(Config()) {}
+
+
+BpoExecutor::BpoExecutor(const Config& cfg)
+  : cfg(cfg), queued(0), n_pinned(0), stopping(false)
+{
+  n_threads = cfg.threads;
+  if (n_threads == 0) {
+    n_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // One queue per worker, plus one for external callers,
+  // or a single shared queue for strict FIFO ordering:
+  const unsigned n_queues =
+    (cfg.scheduling == Scheduling::fifo ? 1 : n_threads);
+  for (unsigned i=0; i<n_queues; ++i) {
+    queues.emplace_back(new Queue);
+  }
+}
+
+
+BpoExecutor::~BpoExecutor() {
+  { std::lock_guard<std::mutex> lock(idle_mtx);
+    stopping = true; }
+  idle_cv.notify_all();
+
+  for (auto& thr : workers) thr.join();
+}
+
+
+void BpoExecutor::parallel_for(std::size_t n,
+                               const std::function<void(std::size_t)>& fn) {
+  if (n == 0) return;
+
+  if (n_threads == 1 || n == 1) {
+    for (std::size_t i=0; i<n; ++i) fn(i);
+    return;
+  }
+
+  std::call_once(started, &BpoExecutor::start, this);
+
+  // Split the range into a few chunks per thread, to allow load-balancing:
+  const std::size_t n_chunks = std::min<std::size_t>(n, 4 * n_threads);
+  const unsigned home = (current_owner == this ? current_index : n_threads - 1);
+
+  Batch batch;
+  batch.remaining = n_chunks;
+
+  for (std::size_t c=0; c<n_chunks; ++c) {
+    const std::size_t begin = n * c / n_chunks, end = n * (c + 1) / n_chunks;
+
+    push([&batch, &fn, begin, end]() {
+        try {
+          for (std::size_t i=begin; i<end; ++i) fn(i);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(batch.mtx);
+          if (!batch.error) batch.error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(batch.mtx);
+        if (--batch.remaining == 0) batch.cv.notify_all();
+      }, home + c);
+  }
+
+  // Help with queued work (from this or any other batch) until ours is done:
+  for (;;) {
+    { std::lock_guard<std::mutex> lock(batch.mtx);
+      if (batch.remaining == 0) break; }
+
+    if (!tryRunOne(home)) {
+      std::unique_lock<std::mutex> lock(batch.mtx);
+      batch.cv.wait_for(lock, std::chrono::milliseconds(1),
+                        [&batch]() { return batch.remaining == 0; });
+    }
+  }
+
+  if (batch.error) std::rethrow_exception(batch.error);
+}
+
+
+BpoExecutor::Affinity BpoExecutor::parseAffinity(const std::string& name) {
+  if (name == "none") return Affinity::none;
+  if (name == "compact") return Affinity::compact;
+  if (name == "scatter") return Affinity::scatter;
+
+  throw std::invalid_argument("unrecognized affinity policy \"" + name + "\"");
+}
+
+
+BpoExecutor::Scheduling BpoExecutor::parseScheduling(const std::string& name) {
+  if (name == "steal") return Scheduling::work_stealing;
+  if (name == "fifo") return Scheduling::fifo;
+
+  throw std::invalid_argument("unrecognized scheduling policy \"" + name + "\"");
+}
+
+
+/** Launch worker threads, leaving one slot for the thread calling parallel_for() */
+void BpoExecutor::start() {
+  const std::vector<unsigned> cpus = allowedCpus();
+
+  for (unsigned idx=0; idx<(n_threads - 1); ++idx) {
+    workers.emplace_back(&BpoExecutor::workerLoop, this, idx);
+    if (bindThread(workers.back(), idx, cpus)) ++n_pinned;
+  }
+}
+
+
+void BpoExecutor::workerLoop(unsigned idx) {
+  current_owner = this;
+  current_index = idx;
+
+  for (;;) {
+    if (tryRunOne(idx)) continue;
+
+    std::unique_lock<std::mutex> lock(idle_mtx);
+    idle_cv.wait(lock, [this]() { return stopping || queued > 0; });
+    if (stopping && queued == 0) return;
+  }
+}
+
+
+void BpoExecutor::push(Task&& task, unsigned hint) {
+  Queue& q = *queues[hint % queues.size()];
+
+  // Count the task before it becomes visible, so that queued never underflows:
+  { std::lock_guard<std::mutex> lock(q.mtx);
+    ++queued;
+    q.tasks.push_back(std::move(task)); }
+
+  { std::lock_guard<std::mutex> lock(idle_mtx); }
+  idle_cv.notify_one();
+}
+
+
+/** Run a single queued task, preferring the newest in our own queue,
+ *  then the oldest in any other queue
+ */
+bool BpoExecutor::tryRunOne(unsigned home) {
+  const std::size_t n_queues = queues.size();
+  Task task;
+
+  for (std::size_t i=0; i<n_queues && !task; ++i) {
+    Queue& q = *queues[(home + i) % n_queues];
+    std::lock_guard<std::mutex> lock(q.mtx);
+
+    if (q.tasks.empty()) continue;
+
+    if (i == 0 && cfg.scheduling == Scheduling::work_stealing) {
+      task = std::move(q.tasks.back());
+      q.tasks.pop_back();
+    } else {
+      task = std::move(q.tasks.front());
+      q.tasks.pop_front();
+    }
+    --queued;
+  }
+
+  if (!task) return false;
+
+  task();
+
+  return true;
+}
+
+
+/** The CPUs on which this process may run, as permitted by taskset, cgroups etc. */
+std::vector<unsigned> BpoExecutor::allowedCpus() {
+  std::vector<unsigned> cpus;
+
+#ifdef __linux__
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+    for (unsigned cpu=0; cpu<CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &mask)) cpus.push_back(cpu);
+    }
+  }
+#endif
+
+  return cpus;
+}
+
+
+/** Pin a worker thread to one of the allowed CPU cores, where the platform permits
+ *
+ *  Returns whether the thread was successfully pinned.
+ */
+bool BpoExecutor::bindThread(std::thread& thr, unsigned idx,
+                             const std::vector<unsigned>& cpus) const {
+  if (cfg.affinity == Affinity::none || cpus.empty()) return false;
+
+#ifdef __linux__
+  const std::size_t n_cpus = cpus.size();
+  std::size_t slot = 0;
+
+  switch (cfg.affinity) {
+    case Affinity::none:
+      return false;
+    case Affinity::compact:
+      slot = idx % n_cpus;
+      break;
+    case Affinity::scatter:
+      slot = (std::size_t(idx) * n_cpus / n_threads) % n_cpus;
+      break;
+  }
+
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  CPU_SET(cpus[slot], &mask);
+
+  return (pthread_setaffinity_np(thr.native_handle(), sizeof(mask), &mask) == 0);
+#else
+  (void)thr; (void)idx;
+  return false;
+#endif
+}
+
+// (C)Copyright 2024, RW Penney
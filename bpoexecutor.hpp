@@ -0,0 +1,97 @@
+/*
+ *  Shared thread-pool for parallel work within BpoModes subcommands
+ *  RW Penney, May 2024
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/** Work-stealing thread pool, shared by all ModeHandlers of a BpoModes parser
+ *
+ *  Worker threads are only started on the first call to parallel_for(),
+ *  so handlers that never use the executor pay nothing for it.
+ *  Calls to parallel_for() may be nested, with the calling thread
+ *  helping to execute queued tasks while waiting for its own to complete.
+ */
+class BpoExecutor {
+  public:
+    enum class Affinity { none, compact, scatter };
+    enum class Scheduling { work_stealing, fifo };
+
+    struct Config {
+      /** Number of threads, including the caller, with zero meaning all cores */
+      unsigned threads = 0;
+      Affinity affinity = Affinity::none;
+      Scheduling scheduling = Scheduling::work_stealing;
+
+      bool operator==(const Config& other) const {
+        return threads == other.threads && affinity == other.affinity
+               && scheduling == other.scheduling; }
+    };
+
+    BpoExecutor();
+    explicit BpoExecutor(const Config& cfg);
+    BpoExecutor(const BpoExecutor&) = delete;
+    BpoExecutor& operator=(const BpoExecutor&) = delete;
+    ~BpoExecutor();
+
+    const Config& config() const { return cfg; }
+
+    /** The number of threads that can simultaneously run tasks */
+    unsigned concurrency() const { return n_threads; }
+
+    /** The number of worker threads successfully bound to a CPU, once started */
+    unsigned pinned() const { return n_pinned; }
+
+    /** Apply fn(i) for each i in [0, n), blocking until all have completed
+     *
+     *  The first exception thrown by any invocation of fn
+     *  is rethrown in the calling thread.
+     */
+    void parallel_for(std::size_t n, const std::function<void(std::size_t)>& fn);
+
+    static Affinity parseAffinity(const std::string&);
+    static Scheduling parseScheduling(const std::string&);
+
+  protected:
+    struct Batch;
+    using Task = std::function<void()>;
+
+    struct Queue {
+      std::mutex mtx;
+      std::deque<Task> tasks;
+    };
+
+    Config cfg;
+    unsigned n_threads;
+
+    std::once_flag started;
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue>> queues;
+
+    std::mutex idle_mtx;
+    std::condition_variable idle_cv;
+    std::atomic<std::size_t> queued;
+    std::atomic<unsigned> n_pinned;
+    bool stopping;
+
+    void start();
+    void workerLoop(unsigned idx);
+    void push(Task&& task, unsigned hint);
+    bool tryRunOne(unsigned home);
+    bool bindThread(std::thread&, unsigned idx, const std::vector<unsigned>& cpus) const;
+    static std::vector<unsigned> allowedCpus();
+};
+
+// (C)Copyright 2024, RW Penney
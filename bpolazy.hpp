@@ -0,0 +1,122 @@
+/*
+ *  Deferred conversion of option values for BpoModes
+ *  RW Penney, May 2024
+ */
+
+#pragma once
+
+#include <boost/program_options.hpp>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+/** Option value whose raw tokens are only converted on first access
+ *
+ *  This allows options carrying very many tokens to be parsed
+ *  cheaply when the selected subcommand only uses some of them.
+ *  Copies share the same tokens and cached value,
+ *  and conversion is safe to trigger from several threads.
+ */
+template <typename T>
+class BpoLazy {
+  protected:
+    template <typename U> struct is_vector : std::false_type {};
+    template <typename U, typename A>
+    struct is_vector<std::vector<U, A>> : std::true_type {};
+
+  public:
+    class Semantic;
+
+    /** Whether the option accepts several tokens, and repeated occurrences */
+    static constexpr bool multi_token = is_vector<T>::value;
+
+    BpoLazy()
+      : state(std::make_shared<State>()) {}
+    explicit BpoLazy(const std::vector<std::string>& tokens)
+      : state(std::make_shared<State>()) {
+      state->tokens = tokens; }
+
+    /** Create a value_semantic, analogous to boost::program_options::value<T>() */
+    static Semantic* value() { return new Semantic; }
+
+    /** The converted value, raising validation_error if the tokens are unsuitable */
+    const T& get() const {
+      std::call_once(state->converted, [this]() {
+          boost::any store;
+          boost::program_options::typed_value<T> converter(nullptr);
+          converter.xparse(store, state->tokens);
+          state->value = boost::any_cast<T>(store);
+          state->is_converted = true; });
+      return state->value; }
+
+    const std::vector<std::string>& tokens() const { return state->tokens; }
+
+    /** Add tokens from a repeated occurrence of a multi-token option
+     *
+     *  Tokens are appended in place while this is their only owner,
+     *  and otherwise copied, so that other copies and any converted value
+     *  (e.g. by eager()) are unaffected.
+     */
+    void append(const std::vector<std::string>& tokens) {
+      if (state.use_count() > 1 || state->is_converted) {
+        auto next = std::make_shared<State>();
+        next->tokens = state->tokens;
+        state = next;
+      }
+      state->tokens.insert(state->tokens.end(), tokens.begin(), tokens.end()); }
+
+  protected:
+    struct State {
+      std::vector<std::string> tokens;
+      std::once_flag converted;
+      std::atomic<bool> is_converted { false };
+      T value;
+    };
+
+    std::shared_ptr<State> state;
+};
+
+
+/** Option semantic for BpoLazy values, optionally converting during parsing
+ *
+ *  Options marked eager() still keep their tokens,
+ *  but have them converted, and any errors reported, within store().
+ */
+template <typename T>
+class BpoLazy<T>::Semantic : public boost::program_options::typed_value<BpoLazy<T>> {
+  public:
+    Semantic()
+      : boost::program_options::typed_value<BpoLazy<T>>(nullptr), is_eager(false) {
+      if (BpoLazy<T>::multi_token) this->multitoken(); }
+
+    Semantic* eager() { is_eager = true; return this; }
+
+    void xparse(boost::any& value_store,
+                const std::vector<std::string>& new_tokens) const {
+      boost::program_options::typed_value<BpoLazy<T>>::xparse(value_store, new_tokens);
+      if (is_eager) boost::any_cast<const BpoLazy<T>&>(value_store).get(); }
+
+  protected:
+    bool is_eager;
+};
+
+
+/** Store raw tokens for later conversion, as invoked by typed_value<BpoLazy<T>> */
+template <typename T>
+void validate(boost::any& v, const std::vector<std::string>& tokens,
+              BpoLazy<T>*, int) {
+  if (v.empty()) {
+    v = BpoLazy<T>(tokens);
+  } else {
+    if (!BpoLazy<T>::multi_token) {
+      throw boost::program_options::multiple_occurrences();
+    }
+    boost::any_cast<BpoLazy<T>&>(v).append(tokens);
+  }
+}
+
+// (C)Copyright 2024, RW Penney
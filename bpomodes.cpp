@@ -3,40 +3,316 @@
  *  RW Penney, May 2024
  */
 
+#include <future>
 #include <iostream>
+#include <set>
+#include <thread>
 #include "bpomodes.hpp"
 
 namespace BoostPO = boost::program_options;
 
 
+/*
+ *  Conversion of execution-policy names, for use by BoostPO::value<>()
+ */
+
+void validate(boost::any& v, const std::vector<std::string>& tokens,
+              BpoExecutor::Affinity*, int) {
+  BoostPO::validators::check_first_occurrence(v);
+  const std::string& token = BoostPO::validators::get_single_string(tokens);
+
+  try {
+    v = BpoExecutor::parseAffinity(token);
+  } catch (std::invalid_argument&) {
+    throw BoostPO::validation_error(BoostPO::validation_error::invalid_option_value);
+  }
+}
+
+
+void validate(boost::any& v, const std::vector<std::string>& tokens,
+              BpoExecutor::Scheduling*, int) {
+  BoostPO::validators::check_first_occurrence(v);
+  const std::string& token = BoostPO::validators::get_single_string(tokens);
+
+  try {
+    v = BpoExecutor::parseScheduling(token);
+  } catch (std::invalid_argument&) {
+    throw BoostPO::validation_error(BoostPO::validation_error::invalid_option_value);
+  }
+}
+
+
+const std::string BpoModes::handler_param = "_subcmd_handler";
+
+
 BpoModes::BpoModes()
-  : add_help(true), opts_finalized(false) {}
+  : add_help(true), exec_enabled(false),
+    exec_opts("execution options"), registry(std::make_shared<Registry>()) {}
 
 
 BpoModes::BpoModes(const BoostPO::options_description& opts, bool add_help)
-  : add_help(add_help), opts_finalized(false), common_opts(opts) {}
+  : add_help(add_help), exec_enabled(false),
+    common_opts(opts), exec_opts("execution options"),
+    registry(std::make_shared<Registry>()) {}
+
+
+BpoModes& BpoModes::addGroup(const std::string& name,
+                             const BoostPO::options_description& opts) {
+  return update([&](Batch& batch) { batch.addGroup(name, opts); });
+}
 
 
 BpoModes& BpoModes::add(const std::string& mode,
                         const BoostPO::options_description& opts,
                         HandlerSP handler) {
+  return update([&](Batch& batch) { batch.add(mode, opts, handler); });
+}
+
+
+BpoModes& BpoModes::replace(const std::string& mode,
+                            const BoostPO::options_description& opts,
+                            HandlerSP handler) {
+  return update([&](Batch& batch) { batch.replace(mode, opts, handler); });
+}
+
+
+bool BpoModes::remove(const std::string& mode) {
+  bool found = false;
+
+  update([&](Batch& batch) { found = batch.remove(mode); });
+
+  return found;
+}
+
+
+BpoModes& BpoModes::addFromGroups(const std::string& mode,
+                                  const std::vector<std::string>& groups,
+                                  const BoostPO::options_description& extra,
+                                  HandlerSP handler) {
+  return update([&](Batch& batch) {
+      batch.addFromGroups(mode, groups, extra, handler); });
+}
+
+
+BpoModes& BpoModes::update(const std::function<void(Batch&)>& changes) {
+  publish([&](Registry& reg) {
+      Batch batch(reg);
+      changes(batch); });
+
+  return *this;
+}
+
+
+/*
+ *  ==== BpoModes::Batch ====
+ */
+
+BpoModes::Batch& BpoModes::Batch::addGroup(const std::string& name,
+                                           const BoostPO::options_description& opts) {
+  reg.option_groups[name] = std::make_shared<const BoostPO::options_description>(opts);
+  reg.group_combinations.clear();
+
+  return *this;
+}
+
+
+BpoModes::Batch& BpoModes::Batch::add(const std::string& mode,
+                                      const BoostPO::options_description& opts,
+                                      HandlerSP handler) {
   if (!handler) {
     handler.reset(new ModeHandler);
   }
 
-  subcommands.emplace(std::make_pair(mode, SubCommand { opts, handler }));
-  selected_subcmd = subcommands.end();
+  const OptionsSP shared_opts = std::make_shared<const BoostPO::options_description>(opts);
+  reg.subcommands.emplace(mode, SubCommand { shared_opts, { shared_opts }, handler });
 
   return *this;
 }
 
 
+BpoModes::Batch& BpoModes::Batch::replace(const std::string& mode,
+                                          const BoostPO::options_description& opts,
+                                          HandlerSP handler) {
+  if (!handler) {
+    handler.reset(new ModeHandler);
+  }
+
+  const OptionsSP shared_opts = std::make_shared<const BoostPO::options_description>(opts);
+  reg.subcommands[mode] = SubCommand { shared_opts, { shared_opts }, handler };
+
+  return *this;
+}
+
+
+bool BpoModes::Batch::remove(const std::string& mode) {
+  return (reg.subcommands.erase(mode) > 0);
+}
+
+
+/** Register a subcommand from shared option groups
+ *
+ *  Group names are resolved once, here, so that parsing only ever
+ *  sees a pre-merged options_description. That holds pointers to the
+ *  groups' own option_description objects, rather than copies of the
+ *  groups, and is itself shared between all subcommands
+ *  using the same list of groups.
+ */
+BpoModes::Batch& BpoModes::Batch::addFromGroups(const std::string& mode,
+                                                const std::vector<std::string>& groups,
+                                                const BoostPO::options_description& extra,
+                                                HandlerSP handler) {
+  if (!handler) {
+    handler.reset(new ModeHandler);
+  }
+
+  std::vector<OptionsSP> sections;
+  for (const auto& name : groups) {
+    const auto grp = reg.option_groups.find(name);
+    if (grp == reg.option_groups.end()) {
+      throw BoostPO::error("option group \"" + name + "\" has not been registered");
+    }
+    sections.push_back(grp->second);
+  }
+  if (!extra.options().empty()) {
+    sections.push_back(std::make_shared<const BoostPO::options_description>(extra));
+  }
+
+  OptionsSP opts;
+  if (sections.size() == 1) {
+    // Reference the interned group directly, without any copying:
+    opts = sections.front();
+  } else if (extra.options().empty() && reg.group_combinations.count(groups)) {
+    opts = reg.group_combinations[groups];
+  } else {
+    auto merged = std::make_shared<BoostPO::options_description>();
+    for (const auto& section : sections) {
+      for (const auto& opt : section->options()) merged->add(opt);
+    }
+    opts = merged;
+    if (extra.options().empty()) reg.group_combinations[groups] = opts;
+  }
+
+  reg.subcommands.emplace(mode, SubCommand { opts, sections, handler });
+
+  return *this;
+}
+
+
+/** Estimate the memory held by option groups and subcommands
+ *
+ *  Option groups and descriptions shared between several subcommands
+ *  are only counted once.
+ */
+std::size_t BpoModes::footprint() const {
+  using OptionSP = boost::shared_ptr<BoostPO::option_description>;
+  const RegistrySP reg = std::atomic_load(&registry);
+  std::set<const void*> seen;
+  std::size_t bytes = 0;
+
+  auto tally_opts = [&](const BoostPO::options_description& opts) {
+    if (!seen.insert(&opts).second) return;
+    bytes += sizeof(opts) + opts.options().size() * sizeof(OptionSP);
+    for (const auto& opt : opts.options()) {
+      if (!seen.insert(opt.get()).second) continue;
+      bytes += sizeof(*opt) + opt->long_name().size()
+               + opt->description().size();
+    }
+  };
+
+  for (const auto& grp : reg->option_groups) {
+    bytes += sizeof(grp) + grp.first.size();
+    tally_opts(*grp.second);
+  }
+
+  for (const auto& cmd : reg->subcommands) {
+    bytes += sizeof(cmd) + cmd.first.size()
+             + cmd.second.sections.size() * sizeof(OptionsSP);
+    tally_opts(*cmd.second.opts);
+    for (const auto& section : cmd.second.sections) tally_opts(*section);
+  }
+
+  for (const auto& combo : reg->group_combinations) {
+    bytes += sizeof(combo) + combo.first.size() * sizeof(std::string);
+    for (const auto& name : combo.first) bytes += name.size();
+  }
+
+  return bytes;
+}
+
+
+BpoModes& BpoModes::addExecutionOptions(unsigned default_threads) {
+  if (exec_enabled) return *this;
+
+  exec_opts.add_options()
+    ("threads",
+      BoostPO::value<unsigned>()->default_value(default_threads),
+      "number of worker threads (0 for all cores)")
+    ("affinity",
+      BoostPO::value<BpoExecutor::Affinity>()
+        ->default_value(BpoExecutor::Affinity::none, "none"),
+      "thread placement [none|compact|scatter]")
+    ("scheduler",
+      BoostPO::value<BpoExecutor::Scheduling>()
+        ->default_value(BpoExecutor::Scheduling::work_stealing, "steal"),
+      "task scheduling [steal|fifo]");
+  exec_enabled = true;
+
+  // Ensure that the new options are seen by subsequent parsing:
+  publish([](Registry& reg) {
+      reg.visible_opts.reset();
+      reg.parse_opts.reset(); });
+
+  return *this;
+}
+
+
+BpoExecutor::Config BpoModes::executionConfig(const BoostPO::variables_map& varmap) const {
+  BpoExecutor::Config cfg;
+
+  if (exec_enabled) {
+    cfg.threads = varmap["threads"].as<unsigned>();
+    cfg.affinity = varmap["affinity"].as<BpoExecutor::Affinity>();
+    cfg.scheduling = varmap["scheduler"].as<BpoExecutor::Scheduling>();
+  }
+
+  return cfg;
+}
+
+
+/** Take a consistent view of the registry, finalizing the shared options if needed */
+BpoModes::RegistrySP BpoModes::snapshot() {
+  RegistrySP reg = std::atomic_load(&registry);
+
+  while (!reg->parse_opts) reg = finalizeCommon();
+
+  return reg;
+}
+
+
+/** Apply an update to a private copy of the registry, and then publish it
+ *
+ *  Should another writer have published a snapshot in the meantime,
+ *  the update is re-applied to that newer version.
+ */
+void BpoModes::publish(const std::function<void(Registry&)>& update) {
+  RegistrySP current = std::atomic_load(&registry);
+
+  for (;;) {
+    auto next = std::make_shared<Registry>(*current);
+    update(*next);
+
+    if (std::atomic_compare_exchange_weak(&registry, &current,
+                                          RegistrySP(std::move(next)))) break;
+  }
+}
+
+
 /** Concatenate names of subcommands for use in help messages etc. */
-std::string BpoModes::subcommandMenu(const std::string& sep) const {
+std::string BpoModes::subcommandMenu(const Registry& reg, const std::string& sep) {
   std::stringstream strm;
   bool first = true;
 
-  for (auto cmd : subcommands) {
+  for (const auto& cmd : reg.subcommands) {
     strm << (first ? "" : sep)
          << cmd.first;
     first = false;
@@ -54,126 +330,464 @@ std::string BpoModes::subcommandMenu(const std::string& sep) const {
  */
 BoostPO::variables_map BpoModes::parse(const std::string& progname,
                                        BoostPO::command_line_parser&& parser) {
+  const RegistrySP reg = snapshot();
+  const SubCommand* selected = nullptr;
   BoostPO::variables_map varmap;
-  std::string subcommand;
   bool print_help = false;
 
-  if (!opts_finalized) finalizeCommon();
-  selected_subcmd = subcommands.end();
-
   try {
-    BoostPO::options_description merged_opts;
-    merged_opts.add(common_opts);
-    merged_opts.add(hidden_opts);
+    const std::vector<std::string> sub_args =
+      parseCommon(*reg, parser, varmap, print_help, selected);
 
-    BoostPO::positional_options_description podesc;
-    podesc.add(subcommand_param.c_str(), 1)
-          .add(subcmd_args_param.c_str(), -1);
+    if (!print_help && selected) {
+      handleSub(*selected, sub_args, varmap);
+      recordHandler(*selected, varmap);
+    }
+  } catch (BoostPO::error& ex) {
+    reportError(progname, ex, *reg, selected);
+  }
 
-    BoostPO::parsed_options parsed_opts =
-      parser.options(merged_opts)
-            .positional(podesc)
-            .allow_unregistered()
-            .run();
+  if (print_help) {
+    printOpts(std::cout, *reg, selected);
+    exit(0);
+  }
 
-    BoostPO::store(parsed_opts, varmap);
-    print_help = (varmap.count("help") > 0);
+  BoostPO::notify(varmap);
 
-    try {
-      subcommand = varmap[subcommand_param].as<std::string>();
-      selected_subcmd = subcommands.find(subcommand);
-      varmap.erase(subcmd_args_param);
-    } catch (std::exception& ex) {
-      // Postpone handling unresolved subcommands
-    }
+  return varmap;
+}
 
-    if (!print_help && !subcommands.empty()) {
-      if (selected_subcmd == subcommands.cend()) {
-        std::stringstream strm;
-        strm << subcommand_param << " \"" << subcommand << "\""
-             << " is not in { " << subcommandMenu(", ") << " }";
-        throw BoostPO::error(strm.str());
-      }
 
-      std::vector<std::string> sub_args =
-        BoostPO::collect_unrecognized(parsed_opts.options,
-                                      BoostPO::include_positional);
-      sub_args.erase(sub_args.begin());
+/** Digest command-line arguments containing lists or ranges of option values
+ *
+ *  The shared options, and any subcommand options with plain values,
+ *  are parsed and converted only once, with each variant then
+ *  receiving a copy of those together with one combination
+ *  of the swept values.
+ */
+std::vector<BoostPO::variables_map>
+BpoModes::sweep(const std::string& progname,
+                BoostPO::command_line_parser&& parser,
+                const std::set<std::string>& swept, SweepMode mode) {
+  const RegistrySP reg = snapshot();
+  const SubCommand* selected = nullptr;
+  BoostPO::variables_map base;
+  std::vector<BoostPO::variables_map> variants;
+  bool print_help = false;
 
-      handleSub(selected_subcmd->second, sub_args, varmap);
+  try {
+    const std::vector<std::string> sub_args =
+      parseCommon(*reg, parser, base, print_help, selected);
+
+    if (!print_help && selected) {
+      variants = expandSweep(*selected, sub_args, base, swept, mode);
+      for (auto& varmap : variants) recordHandler(*selected, varmap);
+    } else {
+      variants.push_back(base);
     }
   } catch (BoostPO::error& ex) {
-    std::cerr << progname << ": " << ex.what() << std::endl << std::endl;
-    printOpts(std::cerr);
-    exit(1);
+    reportError(progname, ex, *reg, selected);
   }
 
   if (print_help) {
-    printOpts(std::cout);
+    printOpts(std::cout, *reg, selected);
     exit(0);
   }
 
-  BoostPO::notify(varmap);
+  for (auto& varmap : variants) {
+    BoostPO::notify(varmap);
+  }
 
-  return varmap;
+  return variants;
 }
 
 
 int BpoModes::run_subcommand(const BoostPO::variables_map& varmap) {
-  if (selected_subcmd == subcommands.end()
-      || !selected_subcmd->second.handler) {
+  const HandlerSP handler = selectedHandler(varmap);
+  const std::shared_ptr<BpoExecutor> exec = acquireExecutor(varmap);
+
+  handler->await_warm_up();
+
+  return handler->run_with(varmap, *exec);
+}
+
+
+/** Run the selected subcommand on each variant produced by sweep()
+ *
+ *  Variants are distributed across the shared executor,
+ *  so ModeHandler::run() must be safe to call concurrently.
+ *  The status codes are returned in the same order as the variants.
+ */
+std::vector<int> BpoModes::run_sweep(const std::vector<BoostPO::variables_map>& variants) {
+  std::vector<int> statuses(variants.size(), 0);
+  if (variants.empty()) return statuses;
+
+  const HandlerSP handler = selectedHandler(variants.front());
+  const std::shared_ptr<BpoExecutor> exec = acquireExecutor(variants.front());
+
+  handler->await_warm_up();
+
+  exec->parallel_for(variants.size(), [&](std::size_t i) {
+      statuses[i] = handler->run_with(variants[i], *exec); });
+
+  return statuses;
+}
+
+
+/** Parse the shared options, identifying the subcommand and its arguments */
+std::vector<std::string> BpoModes::parseCommon(const Registry& reg,
+                                               BoostPO::command_line_parser& parser,
+                                               BoostPO::variables_map& varmap,
+                                               bool& print_help,
+                                               const SubCommand*& selected) {
+  std::string subcommand;
+  std::vector<std::string> sub_args;
+
+  BoostPO::positional_options_description podesc;
+  podesc.add(subcommand_param.c_str(), 1)
+        .add(subcmd_args_param.c_str(), -1);
+
+  BoostPO::parsed_options parsed_opts =
+    parser.options(*reg.parse_opts)
+          .positional(podesc)
+          .allow_unregistered()
+          .run();
+
+  BoostPO::store(parsed_opts, varmap);
+  print_help = (varmap.count("help") > 0);
+
+  try {
+    subcommand = varmap[subcommand_param].as<std::string>();
+    const auto cmd = reg.subcommands.find(subcommand);
+    if (cmd != reg.subcommands.end()) selected = &cmd->second;
+    varmap.erase(subcmd_args_param);
+
+    // Overlap any expensive handler initialization with the remaining parsing:
+    if (selected && !print_help) startWarmUp(selected->handler);
+  } catch (std::exception& ex) {
+    // Postpone handling unresolved subcommands
+  }
+
+  if (!print_help && !reg.subcommands.empty()) {
+    if (!selected) {
+      std::stringstream strm;
+      strm << subcommand_param << " \"" << subcommand << "\""
+           << " is not in { " << subcommandMenu(reg, ", ") << " }";
+      throw BoostPO::error(strm.str());
+    }
+
+    sub_args = BoostPO::collect_unrecognized(parsed_opts.options,
+                                             BoostPO::include_positional);
+    sub_args.erase(sub_args.begin());
+  }
+
+  return sub_args;
+}
+
+
+void BpoModes::reportError(const std::string& progname,
+                           const BoostPO::error& ex,
+                           const Registry& reg, const SubCommand* selected) {
+  std::cerr << progname << ": " << ex.what() << std::endl << std::endl;
+  printOpts(std::cerr, reg, selected);
+
+  // Avoid exiting while a detached warm_up() may still be using the handler:
+  if (selected && selected->handler) {
+    try {
+      selected->handler->await_warm_up();
+    } catch (...) {}
+  }
+
+  exit(1);
+}
+
+
+/** Find the handler of the subcommand recorded in a variables_map
+ *
+ *  This consults the latest registry, so a subcommand that has been
+ *  removed since parsing can no longer be run.
+ */
+/** Note which handler the variables_map was parsed for, hidden from ModeHandler::ingest() */
+void BpoModes::recordHandler(const SubCommand& subcmd, BoostPO::variables_map& varmap) {
+  varmap.insert({ handler_param,
+                  BoostPO::variable_value(boost::any(subcmd.handler), false) });
+}
+
+
+BpoModes::HandlerSP BpoModes::selectedHandler(const BoostPO::variables_map& varmap) {
+  const auto recorded = varmap.find(handler_param);
+  if (recorded != varmap.end()) {
+    if (const HandlerSP* handler = boost::any_cast<HandlerSP>(&recorded->second.value())) {
+      if (*handler) return *handler;
+    }
+  }
+
+  // Fall back to the current registry, for variables_maps not built by parse():
+  const RegistrySP reg = std::atomic_load(&registry);
+  const auto param = varmap.find(subcommand_param);
+  SubCmdMap::const_iterator cmd = reg->subcommands.end();
+
+  if (param != varmap.end()) {
+    cmd = reg->subcommands.find(param->second.as<std::string>());
+  }
+
+  if (cmd == reg->subcommands.end() || !cmd->second.handler) {
     throw BoostPO::validation_error(BoostPO::validation_error::invalid_option,
                                     "nullptr", subcommand_param);
   }
 
-  return selected_subcmd->second.handler->run(varmap);
+  return cmd->second.handler;
 }
 
 
-/** Finalize the shared options_description once all subcommands are known */
-void BpoModes::finalizeCommon(bool add_help) {
-  if (add_help) {
-    common_opts.add_options()
-      ("help,h", "Show usage information");
+/** Launch ModeHandler::warm_up() on a background thread, if requested
+ *
+ *  Only the first call for each handler launches a thread,
+ *  so that concurrent or repeated parses all share a single warm-up.
+ *  The task only holds a weak reference to the handler,
+ *  to avoid a cycle via the handler's own copy of the future.
+ */
+void BpoModes::startWarmUp(const HandlerSP& handler) {
+  if (!handler || !handler->wants_warm_up()) return;
+  if (std::atomic_load(&handler->warming)) return;
+
+  const std::weak_ptr<ModeHandler> weak_handler(handler);
+  auto task = std::make_shared<std::packaged_task<void()>>([weak_handler]() {
+      if (const HandlerSP hdlr = weak_handler.lock()) hdlr->warm_up(); });
+  auto pending = std::make_shared<std::shared_future<void>>(task->get_future().share());
+
+  std::shared_ptr<std::shared_future<void>> expected;
+  if (!std::atomic_compare_exchange_strong(&handler->warming, &expected, pending)) {
+    return;   // Another thread has already launched warm_up()
   }
+  std::thread([task]() { (*task)(); }).detach();
+}
+
+
+/** Share one executor across all runs with the same configuration */
+std::shared_ptr<BpoExecutor> BpoModes::acquireExecutor(const BoostPO::variables_map& varmap) {
+  const BpoExecutor::Config cfg = executionConfig(varmap);
+  std::shared_ptr<BpoExecutor> current = std::atomic_load(&executor);
+
+  if (!current || !(current->config() == cfg)) {
+    auto fresh = std::make_shared<BpoExecutor>(cfg);
+    std::atomic_compare_exchange_strong(&executor, &current, fresh);
+    current = fresh;
+  }
+
+  return current;
+}
 
-  std::stringstream strm;
-  strm << "subcommand [" << subcommandMenu() << "]";
 
-  hidden_opts.add_options()
-    (subcommand_param.c_str(),
-      BoostPO::value<std::string>()->default_value("_default_"),
-      strm.str().c_str())
-    (subcmd_args_param.c_str(),
-      BoostPO::value<std::vector<std::string>>(), "subcommand arguments");
+/** Finalize the shared options_description once all subcommands are known */
+BpoModes::RegistrySP BpoModes::finalizeCommon(bool add_help) {
+  publish([&](Registry& reg) {
+      if (reg.parse_opts) return;
+
+      auto visible = std::make_shared<BoostPO::options_description>(common_opts);
+      if (add_help) {
+        visible->add_options()
+          ("help,h", "Show usage information");
+      }
+
+      std::stringstream strm;
+      strm << "subcommand [" << subcommandMenu(reg) << "]";
+
+      BoostPO::options_description hidden_opts;
+      hidden_opts.add_options()
+        (subcommand_param.c_str(),
+          BoostPO::value<std::string>()->default_value("_default_"),
+          strm.str().c_str())
+        (subcmd_args_param.c_str(),
+          BoostPO::value<std::vector<std::string>>(), "subcommand arguments");
 
-  opts_finalized = true;
+      auto merged = std::make_shared<BoostPO::options_description>();
+      merged->add(*visible);
+      if (exec_enabled) merged->add(exec_opts);
+      merged->add(hidden_opts);
+
+      reg.visible_opts = visible;
+      reg.parse_opts = merged; });
+
+  return std::atomic_load(&registry);
 }
 
 
-void BpoModes::handleSub(SubCommand& subcmd,
+void BpoModes::handleSub(const SubCommand& subcmd,
                          const std::vector<std::string>& args,
                          BoostPO::variables_map& varmap) {
   HandlerSP selected_handler = subcmd.handler;
 
   auto parser =
     BoostPO::command_line_parser(args)
-      .options(subcmd.opts);
+      .options(*subcmd.opts);
 
   BoostPO::store(selected_handler->prepare(parser).run(), varmap);
   selected_handler->ingest(varmap);
 }
 
 
-std::ostream& BpoModes::printOpts(std::ostream& strm) {
-  strm << common_opts
-       << "  [" << subcommandMenu() << "]" << std::endl
+/** Parse subcommand arguments, generating one variables_map per swept combination */
+std::vector<BoostPO::variables_map>
+BpoModes::expandSweep(const SubCommand& subcmd,
+                      const std::vector<std::string>& args,
+                      const BoostPO::variables_map& common,
+                      const std::set<std::string>& swept_names, SweepMode mode) {
+  HandlerSP selected_handler = subcmd.handler;
+
+  auto parser =
+    BoostPO::command_line_parser(args)
+      .options(*subcmd.opts);
+  const BoostPO::parsed_options parsed = selected_handler->prepare(parser).run();
+
+  // Separate options taking lists or ranges from those shared by all variants:
+  BoostPO::parsed_options shared(parsed.description, parsed.m_options_prefix);
+  std::vector<BoostPO::option> swept;
+  std::vector<std::vector<std::string>> choices;
+
+  for (const auto& opt : parsed.options) {
+    std::vector<std::string> alternatives;
+    if (opt.value.size() == 1 && swept_names.count(opt.string_key)) {
+      alternatives = expandSweepToken(opt.value.front());
+    }
+
+    if (alternatives.size() > 1) {
+      swept.push_back(opt);
+      choices.push_back(std::move(alternatives));
+    } else {
+      shared.options.push_back(opt);
+    }
+  }
+
+  BoostPO::variables_map base(common);
+  BoostPO::store(shared, base);
+  selected_handler->ingest(base);
+
+  std::size_t n_variants = 1;
+  for (const auto& alternatives : choices) {
+    if (mode == SweepMode::zipped) {
+      if (n_variants > 1 && alternatives.size() != n_variants) {
+        throw BoostPO::error("zipped sweep requires equal numbers of values for each option");
+      }
+      n_variants = alternatives.size();
+    } else {
+      if (alternatives.size() > max_sweep_variants / n_variants) {
+        throw BoostPO::error("sweep would generate more than "
+                             + std::to_string(max_sweep_variants) + " variants");
+      }
+      n_variants *= alternatives.size();
+    }
+  }
+
+  std::vector<BoostPO::variables_map> variants;
+  variants.reserve(n_variants);
+
+  for (std::size_t v=0; v<n_variants; ++v) {
+    BoostPO::parsed_options point(parsed.description, parsed.m_options_prefix);
+    point.options = swept;
+
+    // Cartesian products vary the final swept option fastest:
+    std::size_t stride = v;
+    for (std::size_t k=swept.size(); k>0; --k) {
+      const auto& alternatives = choices[k - 1];
+      std::size_t pick = v;
+
+      if (mode == SweepMode::cartesian) {
+        pick = stride % alternatives.size();
+        stride /= alternatives.size();
+      }
+      point.options[k - 1].value = { alternatives[pick] };
+    }
+
+    variants.push_back(base);
+    BoostPO::store(point, variants.back());
+  }
+
+  return variants;
+}
+
+
+/** Expand "a|b|c" into a list, or "first..last[:step]" into a range of integers */
+std::vector<std::string> BpoModes::expandSweepToken(const std::string& token) const {
+  std::vector<std::string> values;
+
+  if (token.find('|') != std::string::npos) {
+    std::string::size_type pos = 0, bar;
+    do {
+      bar = token.find('|', pos);
+      values.push_back(token.substr(pos, bar - pos));
+      pos = bar + 1;
+    } while (bar != std::string::npos);
+
+    if (values.size() > max_sweep_variants) {
+      throw BoostPO::error("sweep of \"" + token + "\" would generate more than "
+                           + std::to_string(max_sweep_variants) + " variants");
+    }
+
+    return values;
+  }
+
+  const auto dots = token.find("..");
+  if (dots == std::string::npos || dots == 0) {
+    return { token };
+  }
+
+  const auto colon = token.find(':', dots);
+  long long first, last, step = 1;
+  try {
+    std::size_t used = 0;
+    const std::string lo = token.substr(0, dots),
+                      hi = token.substr(dots + 2, colon - dots - 2);
+
+    first = std::stoll(lo, &used);
+    if (used != lo.size()) return { token };
+    last = std::stoll(hi, &used);
+    if (used != hi.size()) return { token };
+
+    if (colon != std::string::npos) {
+      const std::string st = token.substr(colon + 1);
+      step = std::stoll(st, &used);
+      if (used != st.size() || step <= 0) return { token };
+    }
+  } catch (std::logic_error&) {
+    return { token };
+  }
+
+  const unsigned long long span =
+    (first <= last ? (unsigned long long)(last) - first
+                   : (unsigned long long)(first) - last);
+  if (span / step >= max_sweep_variants) {
+    throw BoostPO::error("sweep of \"" + token + "\" would generate more than "
+                         + std::to_string(max_sweep_variants) + " variants");
+  }
+
+  // Offset from first in unsigned arithmetic, which cannot overflow within the span:
+  const unsigned long long count = span / step + 1;
+  for (unsigned long long k=0; k<count; ++k) {
+    const unsigned long long offset = k * (unsigned long long)(step);
+    values.push_back(std::to_string((long long)(first <= last
+                                                  ? (unsigned long long)(first) + offset
+                                                  : (unsigned long long)(first) - offset)));
+  }
+
+  return values;
+}
+
+
+std::ostream& BpoModes::printOpts(std::ostream& strm, const Registry& reg,
+                                  const SubCommand* selected) {
+  strm << *reg.visible_opts
+       << "  [" << subcommandMenu(reg) << "]" << std::endl
        << "  <subcommand_args> ..." << std::endl
        << std::endl;
 
-  if (selected_subcmd != subcommands.cend()) {
-    strm << selected_subcmd->second.opts;
-    selected_subcmd->second.handler->append_help(strm);
+  if (exec_enabled) {
+    strm << exec_opts << std::endl;
+  }
+
+  if (selected) {
+    for (const auto& section : selected->sections) strm << *section;
+    selected->handler->append_help(strm);
     strm << std::endl;
   }
 
@@ -6,16 +6,25 @@
 #pragma once
 
 #include <boost/program_options.hpp>
+#include <functional>
+#include <future>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
+#include "bpoexecutor.hpp"
+#include "bpolazy.hpp"
 
 
 /** Mechanism for parsing command-line options with program submodes
  *
  *  This allows handling of git-like recipes such as
  *  ./my_prog --common-option mode --mode-option
+ *
+ *  Subcommands may be added, replaced or removed while other threads
+ *  are calling parse(), but the common options and subcommand_param
+ *  should be configured before parsing begins.
  */
 class BpoModes {
   public:
@@ -26,11 +35,43 @@ class BpoModes {
     /** The field in the variables_map describing the user-selected subcommand */
     std::string subcommand_param = "subcommand";
 
+    /** The hidden field in the variables_map recording the handler selected by parse()
+     *
+     *  This lets run_subcommand() use the same handler that the options
+     *  were parsed for, even if the subcommand has since been replaced.
+     */
+    static const std::string handler_param;
+
+    /** Typed access to an option, converting any BpoLazy<T> value on first use */
+    template <typename T>
+    static const T& get(const boost::program_options::variables_map& varmap,
+                        const std::string& key) {
+      const boost::any& v = varmap[key].value();
+      if (const BpoLazy<T>* lazy = boost::any_cast<BpoLazy<T>>(&v)) {
+        return lazy->get(); }
+      return boost::any_cast<const T&>(v); }
+
     /** Mechanism for handling mode-specific parser setup and extraction */
     struct ModeHandler {
       /** Optionally append lines to --help message */
       virtual void append_help(std::ostream&) {}
 
+      /** Whether parse() should launch warm_up() once this subcommand is selected
+       *
+       *  warm_up() runs at most once per handler, however often it is selected.
+       *  It runs on a detached thread, so a program that calls parse()
+       *  without run_subcommand() should call await_warm_up() before exiting.
+       */
+      virtual bool wants_warm_up() const { return false; }
+
+      /** Optionally begin expensive initialization on a background thread, while parsing continues */
+      virtual void warm_up() {}
+
+      /** Wait for any warm_up() launched by parse(), rethrowing its exceptions */
+      void await_warm_up() {
+        const auto pending = std::atomic_load(&warming);
+        if (pending) pending->get(); }
+
       /** Optionally reconfigure the parser before passing command-line arguments */
       virtual boost::program_options::command_line_parser&
       prepare(boost::program_options::command_line_parser& p) {
@@ -42,15 +83,72 @@ class BpoModes {
       /** Entry-point for main() to delegate to the selected subprogram via BpoModes::run_subcommand() */
       virtual int run(const boost::program_options::variables_map&) {
         return 0; }
+
+      /** Entry-point offering the parser's shared executor, which by default defers to run(varmap) */
+      virtual int run_with(const boost::program_options::variables_map& varmap,
+                           BpoExecutor&) {
+        return run(varmap); }
+
+    protected:
+      friend class BpoModes;
+      std::shared_ptr<std::shared_future<void>> warming;
     };
 
     using HandlerSP = std::shared_ptr<ModeHandler>;
+    using OptionsSP = std::shared_ptr<const boost::program_options::options_description>;
+
+    /** Register a named group of options that can be shared between subcommands */
+    BpoModes& addGroup(const std::string& name,
+                       const boost::program_options::options_description&);
 
     /** Register a subcommand, with associated options and parser customization */
     BpoModes& add(const std::string& subcmd,
                   const boost::program_options::options_description&,
                   HandlerSP handler=nullptr);
 
+    /** Replace the options and handler of a subcommand, registering it if necessary */
+    BpoModes& replace(const std::string& subcmd,
+                      const boost::program_options::options_description&,
+                      HandlerSP handler=nullptr);
+
+    /** Unregister a subcommand, returning whether it was present */
+    bool remove(const std::string& subcmd);
+
+    /** Register a subcommand whose options are drawn from named groups
+     *
+     *  The groups must already have been registered via addGroup(),
+     *  and are shared by pointer between all subcommands that use them.
+     */
+    BpoModes& addFromGroups(const std::string& subcmd,
+                            const std::vector<std::string>& groups,
+                            const boost::program_options::options_description& extra
+                              = boost::program_options::options_description(),
+                            HandlerSP handler=nullptr);
+
+    class Batch;
+
+    /** Apply a group of registry changes, publishing them as one new snapshot
+     *
+     *  Each of add(), addGroup() etc. copies the whole registry,
+     *  so this should be preferred when registering many subcommands.
+     *  The changes may be re-applied if another thread updates the registry
+     *  concurrently, and so should not have other side-effects.
+     */
+    BpoModes& update(const std::function<void(Batch&)>& changes);
+
+    /** Approximate heap usage, in bytes, of the subcommand registry */
+    std::size_t footprint() const;
+
+    /** Add --threads, --affinity and --scheduler to the common options
+     *
+     *  These configure the BpoExecutor which run_subcommand()
+     *  passes to the selected ModeHandler.
+     */
+    BpoModes& addExecutionOptions(unsigned default_threads=0);
+
+    /** The executor configuration selected on the command-line */
+    BpoExecutor::Config executionConfig(const boost::program_options::variables_map&) const;
+
     boost::program_options::variables_map parse(int argc, char** argv) {
       return parse((argc > 0 ? argv[0] : ""),
                    boost::program_options::command_line_parser(argc, argv)); }
@@ -59,34 +157,139 @@ class BpoModes {
       return parse(progname, boost::program_options::command_line_parser(args)); }
 
 
+    /** Delegate to the ModeHandler of the subcommand named within the variables_map */
     int run_subcommand(const boost::program_options::variables_map&);
 
+    /** Strategies for combining several swept options */
+    enum class SweepMode { cartesian, zipped };
+
+    /** Upper limit on the number of variants that sweep() may generate */
+    std::size_t max_sweep_variants = 100000;
+
+    /** Digest a command-line whose named subcommand options may take many values
+     *
+     *  Values of the swept options of the form "a|b|c" or "first..last[:step]"
+     *  are expanded into a list of variants, combined either as a
+     *  cartesian product or element-by-element. Values of all other options
+     *  are taken literally. ModeHandler::ingest() only sees the options
+     *  that are shared by all variants.
+     */
+    std::vector<boost::program_options::variables_map>
+    sweep(int argc, char** argv, const std::set<std::string>& swept,
+          SweepMode mode=SweepMode::cartesian) {
+      return sweep((argc > 0 ? argv[0] : ""),
+                   boost::program_options::command_line_parser(argc, argv), swept, mode); }
+    std::vector<boost::program_options::variables_map>
+    sweep(const std::string& progname, const std::vector<std::string>& args,
+          const std::set<std::string>& swept, SweepMode mode=SweepMode::cartesian) {
+      return sweep(progname, boost::program_options::command_line_parser(args), swept, mode); }
+
+    std::vector<int> run_sweep(const std::vector<boost::program_options::variables_map>&);
+
   protected:
     struct SubCommand {
-      boost::program_options::options_description opts;
+      /** All options of the subcommand, for parsing */
+      OptionsSP opts;
+
+      /** The groups and private options making up opts, for --help */
+      std::vector<OptionsSP> sections;
+
       HandlerSP handler;
     };
 
+    using SubCmdMap = std::map<std::string, SubCommand>;
+
+    /** Immutable snapshot of the registered option groups and subcommands
+     *
+     *  Parsers take a snapshot via a single atomic load, while writers
+     *  publish modified copies, so that the registry can be updated
+     *  while other threads are parsing.
+     */
+    struct Registry {
+      std::map<std::string, OptionsSP> option_groups;
+      SubCmdMap subcommands;
+
+      /** Merged options shared by all subcommands using the same list of groups */
+      std::map<std::vector<std::string>, OptionsSP> group_combinations;
+
+      /** The shared options, as shown by --help, once finalized */
+      OptionsSP visible_opts;
+
+      /** The shared options, plus hidden positional options, once finalized */
+      OptionsSP parse_opts;
+    };
+
+    using RegistrySP = std::shared_ptr<const Registry>;
+
     const std::string subcmd_args_param = "_subcmd_args";
 
     bool add_help;
-    bool opts_finalized;
+    bool exec_enabled;
     boost::program_options::options_description common_opts;
-    boost::program_options::options_description hidden_opts;
+    boost::program_options::options_description exec_opts;
+    RegistrySP registry;
+    std::shared_ptr<BpoExecutor> executor;
 
-    using SubCmdMap = std::map<std::string, SubCommand>;
-    SubCmdMap subcommands;
-    SubCmdMap::iterator selected_subcmd;
-    std::string subcommandMenu(const std::string& sep="|") const;
+    RegistrySP snapshot();
+    void publish(const std::function<void(Registry&)>& update);
+    static std::string subcommandMenu(const Registry&, const std::string& sep="|");
 
     boost::program_options::variables_map parse(const std::string& progname,
                                                 boost::program_options::command_line_parser&&);
+    std::vector<boost::program_options::variables_map>
+    sweep(const std::string& progname,
+          boost::program_options::command_line_parser&&,
+          const std::set<std::string>& swept, SweepMode);
 
-    void finalizeCommon(bool add_help=true);
-    void handleSub(SubCommand& cmd, const std::vector<std::string>& args,
+    RegistrySP finalizeCommon(bool add_help=true);
+    std::vector<std::string> parseCommon(const Registry&,
+                                         boost::program_options::command_line_parser&,
+                                         boost::program_options::variables_map&,
+                                         bool& print_help, const SubCommand*& selected);
+    void handleSub(const SubCommand& cmd, const std::vector<std::string>& args,
                    boost::program_options::variables_map&);
+    std::vector<boost::program_options::variables_map>
+    expandSweep(const SubCommand& cmd, const std::vector<std::string>& args,
+                const boost::program_options::variables_map& common,
+                const std::set<std::string>& swept, SweepMode);
+    std::vector<std::string> expandSweepToken(const std::string&) const;
+    static void startWarmUp(const HandlerSP&);
+
+    static void recordHandler(const SubCommand&, boost::program_options::variables_map&);
+    HandlerSP selectedHandler(const boost::program_options::variables_map&);
+    std::shared_ptr<BpoExecutor> acquireExecutor(const boost::program_options::variables_map&);
+
+    [[noreturn]] void reportError(const std::string& progname,
+                                  const boost::program_options::error&,
+                                  const Registry&, const SubCommand* selected);
+
+    std::ostream& printOpts(std::ostream&, const Registry&, const SubCommand* selected);
+};
+
+
+/** Registry changes that BpoModes::update() will publish together */
+class BpoModes::Batch {
+  public:
+    Batch& addGroup(const std::string& name,
+                    const boost::program_options::options_description&);
+    Batch& add(const std::string& subcmd,
+               const boost::program_options::options_description&,
+               HandlerSP handler=nullptr);
+    Batch& replace(const std::string& subcmd,
+                   const boost::program_options::options_description&,
+                   HandlerSP handler=nullptr);
+    bool remove(const std::string& subcmd);
+    Batch& addFromGroups(const std::string& subcmd,
+                         const std::vector<std::string>& groups,
+                         const boost::program_options::options_description& extra
+                           = boost::program_options::options_description(),
+                         HandlerSP handler=nullptr);
+
+  protected:
+    friend class BpoModes;
+    explicit Batch(Registry& reg): reg(reg) {}
 
-    std::ostream& printOpts(std::ostream&);
+    Registry& reg;
 };
 
 // (C)Copyright 2024, RW Penney
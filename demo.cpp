@@ -107,6 +107,7 @@ int main(int argc, char* argv[])
       << vm["subcommand"].as<std::string>() << std::endl
       << "VARIABLES: " << std::endl;
   for (auto v : vm) {
+    if (v.first == BpoModes::handler_param) continue;
     std::cout << v.first << "= ???" << std::endl;
   }
 
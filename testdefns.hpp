@@ -6,8 +6,10 @@
 
 #include <boost/program_options.hpp>
 #include <boost/test/unit_test.hpp>
+#include <atomic>
 #include <set>
 #include <string>
+#include <thread>
 
 #include "bpomodes.hpp"
 
@@ -42,6 +44,9 @@ struct TestModes : TestSuite {
 
   static void dispatch();
   static void modename();
+  static void groups();
+  static void updates();
+  static void lazy();
 };
 
 
@@ -51,6 +56,9 @@ struct TestModeAPI : TestSuite {
 
   static void basic();
   static void positional();
+  static void executor();
+  static void sweep();
+  static void warm_up();
 
   struct MHstats: public BpoModes::ModeHandler {
     unsigned prep_count = 0, ingest_count = 0, run_count = 0;
@@ -77,6 +85,71 @@ struct TestModeAPI : TestSuite {
       p.positional(positional); return p; }
     BoostPO::positional_options_description positional;
   };
+
+  struct MHparallel: public BpoModes::ModeHandler {
+    unsigned concurrency = 0, pinned = 0;
+    int run_with(const BoostPO::variables_map& vm, BpoExecutor& exec) {
+      concurrency = exec.concurrency();
+      const unsigned n = vm["count"].as<unsigned>();
+      std::vector<unsigned> sums(n, 0);
+      exec.parallel_for(n, [&](std::size_t i) {
+          std::atomic<unsigned> inner(0);
+          exec.parallel_for(i + 1, [&](std::size_t j) { inner += j; });
+          sums[i] = inner; });
+      unsigned total = 0;
+      for (auto s : sums) total += s;
+      pinned = exec.pinned();
+      return total; }
+  };
+
+  struct MHsweep: public BpoModes::ModeHandler {
+    unsigned ingest_count = 0;
+    void ingest(const BoostPO::variables_map&) {
+      ++ingest_count; }
+    int run(const BoostPO::variables_map& vm) {
+      const std::string things = vm["things"].as<std::string>();
+      return (things[0] - 'a') * 1000 + vm["level"].as<int>() * 10
+              + vm["loglevel"].as<int>(); }
+  };
+
+  struct MHwarm: public BpoModes::ModeHandler {
+    std::atomic<bool> warmed { false }, fail { false };
+    std::atomic<unsigned> n_warm_ups { 0 };
+    std::thread::id warm_thread;
+    bool wants_warm_up() const { return true; }
+    void warm_up() {
+      ++n_warm_ups;
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      warm_thread = std::this_thread::get_id();
+      if (fail) throw std::runtime_error("warm-up failed");
+      warmed = true; }
+    int run(const BoostPO::variables_map&) {
+      return (warmed ? 1 : 0); }
+  };
+};
+
+
+/** Test allocation and latency budgets of parsing, across registry sizes */
+struct TestPerf : TestSuite {
+  TestPerf();
+
+  static void modes();
+  static void mode_api();
+
+  struct Measurement {
+    std::size_t allocs;
+    double millisecs;
+  };
+
+  /** Average the heap allocations and wall-clock time of repeated calls to fn */
+  template <typename Fn>
+  static Measurement measure(Fn fn, unsigned reps=1);
+
+  static std::size_t allocation_count();
+  static void check_budget(const std::string& scenario, const std::string& phase,
+                           const Measurement&, std::size_t max_allocs,
+                           double max_millisecs);
+  static Measurement modes_scenario(unsigned n_modes);
 };
 
 
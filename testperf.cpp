@@ -0,0 +1,197 @@
+/*
+ *  Allocation and latency regression tests for BpoModes
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include "testdefns.hpp"
+
+
+/*
+ *  Interposed global allocator, counting all heap allocations
+ */
+
+namespace {
+  std::atomic<std::size_t> heap_allocations(0);
+}
+
+
+void* operator new(std::size_t size) {
+  ++heap_allocations;
+  if (void* ptr = std::malloc(size > 0 ? size : 1)) return ptr;
+  throw std::bad_alloc();
+}
+
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+
+namespace bpomodes {
+  namespace testing {
+
+/*
+ *  ==== TestPerf ====
+ */
+
+TestPerf::TestPerf()
+  : TestSuite("performance budgets")
+{
+  add(BOOST_TEST_CASE(modes));
+  add(BOOST_TEST_CASE(mode_api));
+}
+
+
+std::size_t TestPerf::allocation_count() {
+  return heap_allocations.load();
+}
+
+
+template <typename Fn>
+TestPerf::Measurement TestPerf::measure(Fn fn, unsigned reps) {
+  using Clock = std::chrono::steady_clock;
+
+  const std::size_t allocs0 = allocation_count();
+  const auto t0 = Clock::now();
+
+  for (unsigned r=0; r<reps; ++r) fn();
+
+  const auto t1 = Clock::now();
+  const std::size_t allocs1 = allocation_count();
+
+  return Measurement {
+    (allocs1 - allocs0) / reps,
+    std::chrono::duration<double, std::milli>(t1 - t0).count() / reps };
+}
+
+
+void TestPerf::check_budget(const std::string& scenario, const std::string& phase,
+                            const Measurement& m, std::size_t max_allocs,
+                            double max_millisecs) {
+  BOOST_TEST_MESSAGE(scenario << ": phase \"" << phase << "\" made "
+                     << m.allocs << " allocations in " << m.millisecs << "ms");
+  BOOST_CHECK_MESSAGE(m.allocs <= max_allocs,
+                      scenario << ": phase \"" << phase << "\" made " << m.allocs
+                      << " allocations, exceeding budget of " << max_allocs);
+
+  // Timings vary too much between machines and sanitizer builds to fail on,
+  // unless explicitly requested:
+  if (std::getenv("BPO_STRICT_LATENCY")) {
+    BOOST_CHECK_MESSAGE(m.millisecs <= max_millisecs,
+                        scenario << ": phase \"" << phase << "\" took " << m.millisecs
+                        << "ms, exceeding budget of " << max_millisecs << "ms");
+  } else {
+    BOOST_WARN_MESSAGE(m.millisecs <= max_millisecs,
+                       scenario << ": phase \"" << phase << "\" took " << m.millisecs
+                       << "ms, exceeding budget of " << max_millisecs << "ms");
+  }
+}
+
+
+/** Dispatch across a registry of many subcommands built from shared groups,
+ *  returning the per-parse cost
+ */
+TestPerf::Measurement TestPerf::modes_scenario(unsigned n_modes) {
+  std::stringstream scenario;
+  scenario << "TestModes[" << n_modes << " modes]";
+
+  BoostPO::options_description common_opts("common_options"),
+    io_opts("I/O"), tuning_opts("tuning");
+
+  common_opts.add_options()
+    ("loglevel,L",
+      BoostPO::value<int>()->default_value(0), "logging level");
+  io_opts.add_options()
+    ("input,i", BoostPO::value<std::string>())
+    ("output,o", BoostPO::value<std::string>()->default_value("-"));
+  tuning_opts.add_options()
+    ("level", BoostPO::value<int>()->default_value(3));
+
+  BpoModes parser(common_opts);
+
+  const auto reg = measure([&]() {
+      parser.update([&](BpoModes::Batch& batch) {
+          batch.addGroup("io", io_opts)
+               .addGroup("tuning", tuning_opts);
+          for (unsigned i=0; i<n_modes; ++i) {
+            batch.addFromGroups("mode" + std::to_string(i), { "io", "tuning" });
+          } }); });
+  check_budget(scenario.str(), "register", reg,
+               64 + 16 * n_modes, 0.25 * n_modes);
+
+  const auto args = split("-L 2 mode" + std::to_string(n_modes / 2)
+                          + " -i source --level 7");
+
+  const auto first = measure([&]() { parser.parse("dummy_prog", args); });
+  check_budget(scenario.str(), "first parse", first, 300 + 2 * n_modes, 20.0);
+
+  const auto steady = measure([&]() { parser.parse("dummy_prog", args); }, 200);
+  check_budget(scenario.str(), "parse", steady, 300, 1.0);
+
+  return steady;
+}
+
+
+void TestPerf::modes() {
+  const Measurement small = modes_scenario(8),
+                    large = modes_scenario(512);
+
+  // Steady-state parsing should not depend on the number of subcommands:
+  BOOST_CHECK_MESSAGE(large.allocs <= small.allocs + small.allocs / 8,
+                      "TestModes: phase \"parse\" made " << large.allocs
+                      << " allocations with 512 modes, versus "
+                      << small.allocs << " with 8 modes");
+}
+
+
+/** Dispatch through ModeHandlers, within a large registry */
+void TestPerf::mode_api() {
+  const std::string scenario = "TestModeAPI[256 modes]";
+  BoostPO::options_description alpha_opts("mode alpha"), beta_opts("mode beta");
+  auto mh_beta = std::make_shared<TestModeAPI::MHstats>();
+
+  alpha_opts.add_options()
+    ("a0", BoostPO::value<int>())
+    ("a1", BoostPO::value<int>()->default_value(5));
+  beta_opts.add_options()
+    ("b0", BoostPO::value<int>())
+    ("b1", BoostPO::value<int>()->default_value(17));
+
+  // Fix the executor's size, whose construction is counted within the first run:
+  BpoModes parser;
+  parser.subcommand_param = "the_mode";
+  parser.addExecutionOptions(1);
+  parser.update([&](BpoModes::Batch& batch) {
+      for (unsigned i=0; i<255; ++i) {
+        batch.add("alpha" + std::to_string(i), alpha_opts,
+                  std::make_shared<TestModeAPI::MHstats>());
+      }
+      batch.add("beta", beta_opts, mh_beta); });
+
+  const auto args = split("beta --b0 17");
+  parser.parse("dummy_prog", args);
+
+  BoostPO::variables_map vm;
+  const auto parse = measure([&]() { vm = parser.parse("dummy_prog", args); }, 200);
+  check_budget(scenario, "parse", parse, 200, 1.0);
+
+  const auto first_run = measure([&]() { parser.run_subcommand(vm); });
+  check_budget(scenario, "first run", first_run, 32, 5.0);
+
+  const auto run = measure([&]() { parser.run_subcommand(vm); }, 200);
+  check_budget(scenario, "run", run, 8, 0.1);
+
+  BOOST_CHECK_EQUAL(mh_beta->run_count, 201);
+}
+
+
+  }   // namespace testing
+}   // namespace bpomodes
@@ -1,3 +1,8 @@
+#include <thread>
+#ifdef __linux__
+#  include <pthread.h>
+#  include <sched.h>
+#endif
 #include "testdefns.hpp"
 
 
@@ -53,6 +58,9 @@ TestModes::TestModes()
 {
   add(BOOST_TEST_CASE(dispatch));
   add(BOOST_TEST_CASE(modename));
+  add(BOOST_TEST_CASE(groups));
+  add(BOOST_TEST_CASE(updates));
+  add(BOOST_TEST_CASE(lazy));
 }
 
 
@@ -144,6 +152,229 @@ void TestModes::modename() {
 }
 
 
+void TestModes::groups() {
+  BoostPO::options_description io_opts("I/O"), tuning_opts("tuning"),
+    extra_opts("extras");
+
+  io_opts.add_options()
+    ("input,i", BoostPO::value<std::string>())
+    ("output,o", BoostPO::value<std::string>()->default_value("-"));
+  tuning_opts.add_options()
+    ("level", BoostPO::value<int>()->default_value(3));
+  extra_opts.add_options()
+    ("verbose,v", "verbose output");
+
+  BpoModes parser;
+  parser.addGroup("io", io_opts)
+        .addGroup("tuning", tuning_opts);
+
+  parser.addFromGroups("alpha", { "io" })
+        .addFromGroups("beta", { "io", "tuning" }, extra_opts);
+
+  BOOST_CHECK_THROW(parser.addFromGroups("gamma", { "io", "nonexistent" }),
+                    BoostPO::error);
+
+  { const auto vm = parser.parse("dummy_prog", split("alpha -i source"));
+    check_vm_keys(vm, { "subcommand", "input", "output" });
+    BOOST_CHECK_EQUAL(vm["input"].as<std::string>(), "source");
+    BOOST_CHECK_EQUAL(vm["output"].as<std::string>(), "-");
+  }
+
+  { const auto vm = parser.parse("dummy_prog",
+                                 split("beta --level 9 -v -o dest"));
+    check_vm_keys(vm, { "subcommand", "output", "level", "verbose" });
+    BOOST_CHECK_EQUAL(vm["level"].as<int>(), 9);
+    BOOST_CHECK_EQUAL(vm["output"].as<std::string>(), "dest");
+  }
+
+  // Shared groups should grow the registry much less than private copies:
+  BpoModes shared_parser, copied_parser;
+  shared_parser.addGroup("io", io_opts);
+  for (int i=0; i<50; ++i) {
+    const std::string mode = "mode" + std::to_string(i);
+    shared_parser.addFromGroups(mode, { "io" });
+    copied_parser.add(mode, io_opts);
+  }
+  BOOST_CHECK_LT(shared_parser.footprint(), copied_parser.footprint());
+
+  // Modes drawing on several groups should share one merged description:
+  BpoModes multi_parser;
+  multi_parser.addGroup("io", io_opts)
+              .addGroup("tuning", tuning_opts);
+  std::size_t footprints[2];
+  for (int block=0; block<2; ++block) {
+    for (int i=0; i<100; ++i) {
+      const std::string mode = "mode" + std::to_string(100 * block + i);
+      multi_parser.addFromGroups(mode, { "io", "tuning" });
+    }
+    footprints[block] = multi_parser.footprint();
+  }
+  BOOST_CHECK_LT((footprints[1] - footprints[0]) / 100, 200);
+
+  { const auto vm = multi_parser.parse("dummy_prog",
+                                       split("mode137 -i source --level 4"));
+    check_vm_keys(vm, { "subcommand", "input", "output", "level" });
+    BOOST_CHECK_EQUAL(vm["level"].as<int>(), 4);
+  }
+}
+
+
+void TestModes::updates() {
+  BoostPO::options_description alpha_opts("mode alpha"), beta_opts("mode beta"),
+    other_opts("other modes");
+
+  alpha_opts.add_options()
+    ("stuff", BoostPO::value<std::string>());
+  beta_opts.add_options()
+    ("things", BoostPO::value<int>());
+  other_opts.add_options()
+    ("junk", BoostPO::value<int>());
+
+  BpoModes parser;
+  parser.add("alpha", alpha_opts);
+
+  BOOST_CHECK_EQUAL(parser.parse("dummy_prog", split("alpha --stuff x"))
+                      ["stuff"].as<std::string>(), "x");
+
+  BOOST_CHECK(!parser.remove("beta"));
+  parser.add("beta", beta_opts);
+  BOOST_CHECK_EQUAL(parser.parse("dummy_prog", split("beta --things 3"))
+                      ["things"].as<int>(), 3);
+  BOOST_CHECK(parser.remove("beta"));
+
+  parser.replace("alpha", beta_opts);
+  BOOST_CHECK_EQUAL(parser.parse("dummy_prog", split("alpha --things 5"))
+                      ["things"].as<int>(), 5);
+  parser.replace("alpha", alpha_opts);
+
+  { // Running a parsed command uses the handler it was parsed for:
+    auto original = std::make_shared<TestModeAPI::MHstats>(),
+         successor = std::make_shared<TestModeAPI::MHstats>();
+    parser.add("epsilon", alpha_opts, original);
+    const auto vm = parser.parse("dummy_prog", split("epsilon --stuff x"));
+    parser.replace("epsilon", beta_opts, successor);
+    BOOST_CHECK_EQUAL(parser.run_subcommand(vm), 7);
+    BOOST_CHECK_EQUAL(original->run_count, 1);
+    BOOST_CHECK_EQUAL(successor->run_count, 0);
+  }
+
+  parser.update([&](BpoModes::Batch& batch) {
+      batch.add("gamma", beta_opts)
+           .add("delta", beta_opts);
+      batch.remove("gamma"); });
+  BOOST_CHECK(!parser.remove("gamma"));
+  BOOST_CHECK_EQUAL(parser.parse("dummy_prog", split("delta --things 11"))
+                      ["things"].as<int>(), 11);
+
+  // Parse from several threads while the registry is being modified:
+  std::atomic<bool> writing(true);
+  std::atomic<unsigned> n_ok(0), n_parsed(0);
+  std::vector<std::thread> readers;
+
+  for (int t=0; t<3; ++t) {
+    readers.emplace_back([&]() {
+        do {
+          const auto vm = parser.parse("dummy_prog", split("alpha --stuff lemon"));
+          if (vm["stuff"].as<std::string>() == "lemon") ++n_ok;
+          ++n_parsed;
+        } while (writing); });
+  }
+
+  for (int i=0; i<200; ++i) {
+    const std::string mode = "other" + std::to_string(i);
+    parser.add(mode, other_opts);
+    if (i % 2) parser.remove(mode);
+  }
+  writing = false;
+  for (auto& thr : readers) thr.join();
+
+  BOOST_CHECK_GT(n_parsed.load(), 0);
+  BOOST_CHECK_EQUAL(n_ok.load(), n_parsed.load());
+  BOOST_CHECK_EQUAL(parser.parse("dummy_prog", split("other198 --junk 9"))
+                      ["junk"].as<int>(), 9);
+}
+
+
+void TestModes::lazy() {
+  using LazyNums = BpoLazy<std::vector<double>>;
+  BoostPO::options_description common_opts, calc_opts("mode calc");
+
+  common_opts.add_options()
+    ("scale", BpoLazy<int>::value()->eager());
+  calc_opts.add_options()
+    ("nums", LazyNums::value())
+    ("count", BpoLazy<unsigned>::value());
+
+  BpoModes parser(common_opts);
+  parser.add("calc", calc_opts);
+
+  { const auto vm = parser.parse("dummy_prog",
+                                 split("--scale 3 calc --nums 1.5 2.5 --count 4 --nums 8"));
+    const auto& nums = vm["nums"].as<LazyNums>();
+    BOOST_CHECK_EQUAL(nums.tokens().size(), 3);
+
+    const auto& values = BpoModes::get<std::vector<double>>(vm, "nums");
+    const std::vector<double> expected { 1.5, 2.5, 8.0 };
+    BOOST_CHECK_EQUAL_COLLECTIONS(values.cbegin(), values.cend(),
+                                  expected.cbegin(), expected.cend());
+    BOOST_CHECK_EQUAL(&nums.get(), &values);
+
+    BOOST_CHECK_EQUAL(BpoModes::get<int>(vm, "scale"), 3);
+    BOOST_CHECK_EQUAL(BpoModes::get<unsigned>(vm, "count"), 4);
+  }
+
+  { // Unsuitable tokens are only diagnosed when accessed:
+    const auto vm = parser.parse("dummy_prog",
+                                 split("calc --nums 1.0 lemon --count 2"));
+    BOOST_CHECK_EQUAL(BpoModes::get<unsigned>(vm, "count"), 2);
+    BOOST_CHECK_THROW(BpoModes::get<std::vector<double>>(vm, "nums"),
+                      BoostPO::validation_error);
+  }
+
+  { // Repeated occurrences do not affect copies, or converted values:
+    LazyNums direct(std::vector<std::string>{ "1" });
+    const LazyNums alias = direct;
+    direct.append({ "2", "3" });
+    BOOST_CHECK_EQUAL(alias.tokens().size(), 1);
+    BOOST_CHECK_EQUAL(direct.tokens().size(), 3);
+
+    const LazyNums earlier = direct;
+    const auto& converted = earlier.get();
+    direct.append({ "4" });
+    BOOST_CHECK_EQUAL(converted.size(), 3);
+    BOOST_CHECK_EQUAL(alias.get().size(), 1);
+    BOOST_CHECK_EQUAL(direct.get().size(), 4);
+  }
+
+  { // Swept variants each compose their own copy of the tokens:
+    BoostPO::options_description sum_opts("mode sum");
+    sum_opts.add_options()
+      ("terms", LazyNums::value()->composing());
+
+    BpoModes summer;
+    summer.add("sum", sum_opts);
+    const auto variants = summer.sweep("dummy_prog",
+                                       split("sum --terms 1 --terms 2|3"), { "terms" });
+    BOOST_REQUIRE_EQUAL(variants.size(), 2);
+
+    const std::vector<double> first { 1, 2 }, second { 1, 3 };
+    const auto& terms0 = BpoModes::get<std::vector<double>>(variants[0], "terms");
+    const auto& terms1 = BpoModes::get<std::vector<double>>(variants[1], "terms");
+    BOOST_CHECK_EQUAL_COLLECTIONS(terms0.cbegin(), terms0.cend(),
+                                  first.cbegin(), first.cend());
+    BOOST_CHECK_EQUAL_COLLECTIONS(terms1.cbegin(), terms1.cend(),
+                                  second.cbegin(), second.cend());
+  }
+
+  { // Eager options are diagnosed within store():
+    BoostPO::variables_map vm;
+    BOOST_CHECK_THROW(BoostPO::store(BoostPO::command_line_parser(split("--scale x"))
+                                       .options(common_opts).run(), vm),
+                      BoostPO::validation_error);
+  }
+}
+
+
 /*
  *  ==== TestModeAPI ====
  */
@@ -153,6 +384,9 @@ void TestModes::modename() {
 {
   add(BOOST_TEST_CASE(basic));
   add(BOOST_TEST_CASE(positional));
+  add(BOOST_TEST_CASE(executor));
+  add(BOOST_TEST_CASE(sweep));
+  add(BOOST_TEST_CASE(warm_up));
 }
 
 
@@ -262,5 +496,170 @@ void TestModeAPI::positional() {
 }
 
 
+void TestModeAPI::executor() {
+  BoostPO::options_description sum_opts("mode sum");
+  auto handler = std::make_shared<MHparallel>();
+
+  sum_opts.add_options()
+    ("count", BoostPO::value<unsigned>()->default_value(40));
+
+  BpoModes parser;
+  parser.addExecutionOptions(2)
+        .add("sum", sum_opts, handler);
+
+  { const auto vm = parser.parse("dummy_prog", split("sum"));
+    const auto cfg = parser.executionConfig(vm);
+    BOOST_CHECK_EQUAL(cfg.threads, 2);
+    BOOST_CHECK(cfg.affinity == BpoExecutor::Affinity::none);
+    BOOST_CHECK(cfg.scheduling == BpoExecutor::Scheduling::work_stealing);
+
+    // Sum over i<40 of i(i+1)/2:
+    BOOST_CHECK_EQUAL(parser.run_subcommand(vm), 10660);
+    BOOST_CHECK_EQUAL(handler->concurrency, 2);
+  }
+
+  for (auto sched : { "steal", "fifo" }) {
+    const auto vm = parser.parse("dummy_prog",
+                                 split(std::string("--threads 4 --affinity compact --scheduler ")
+                                       + sched + " sum --count 100"));
+    const auto cfg = parser.executionConfig(vm);
+    BOOST_CHECK_EQUAL(cfg.threads, 4);
+    BOOST_CHECK(cfg.affinity == BpoExecutor::Affinity::compact);
+
+    BOOST_CHECK_EQUAL(parser.run_subcommand(vm), 166650);
+    BOOST_CHECK_EQUAL(handler->concurrency, 4);
+    BOOST_CHECK(handler->pinned <= 3);
+#ifdef __linux__
+    // Where this thread may be re-pinned to its current CPUs, so may the workers:
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0
+        && pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0) {
+      BOOST_CHECK_EQUAL(handler->pinned, 3);
+    }
+#endif
+  }
+
+  BpoExecutor exec;
+  BOOST_CHECK_THROW(exec.parallel_for(100, [](std::size_t i) {
+                        if (i == 57) throw std::runtime_error("failed"); }),
+                    std::runtime_error);
+}
+
+
+void TestModeAPI::sweep() {
+  BoostPO::options_description common_opts, two_opts("mode two");
+  auto handler = std::make_shared<MHsweep>();
+
+  common_opts.add_options()
+    ("loglevel,L", BoostPO::value<int>()->default_value(0));
+  two_opts.add_options()
+    ("things", BoostPO::value<std::string>()->default_value("a"))
+    ("level", BoostPO::value<int>()->default_value(1));
+
+  BpoModes parser(common_opts);
+  parser.addExecutionOptions(3)
+        .add("two", two_opts, handler);
+
+  { const auto variants = parser.sweep("dummy_prog",
+                                       split("-L 4 two --things a|b|c --level 1..64"),
+                                       { "things", "level" });
+    BOOST_REQUIRE_EQUAL(variants.size(), 3 * 64);
+    BOOST_CHECK_EQUAL(handler->ingest_count, 1);
+
+    BOOST_CHECK_EQUAL(variants[0]["things"].as<std::string>(), "a");
+    BOOST_CHECK_EQUAL(variants[0]["level"].as<int>(), 1);
+    BOOST_CHECK_EQUAL(variants[1]["level"].as<int>(), 2);
+    BOOST_CHECK_EQUAL(variants[64]["things"].as<std::string>(), "b");
+    BOOST_CHECK_EQUAL(variants.back()["things"].as<std::string>(), "c");
+    BOOST_CHECK_EQUAL(variants.back()["level"].as<int>(), 64);
+
+    const auto statuses = parser.run_sweep(variants);
+    BOOST_REQUIRE_EQUAL(statuses.size(), variants.size());
+    for (std::size_t i=0; i<statuses.size(); ++i) {
+      BOOST_CHECK_EQUAL(statuses[i], (i / 64) * 1000 + (i % 64 + 1) * 10 + 4);
+    }
+  }
+
+  { const auto variants = parser.sweep("dummy_prog",
+                                       split("two --things c|b|a --level 30..10:10"),
+                                       { "things", "level" },
+                                       BpoModes::SweepMode::zipped);
+    const auto statuses = parser.run_sweep(variants);
+    const std::vector<int> expected { 2300, 1200, 100 };
+    BOOST_CHECK_EQUAL_COLLECTIONS(statuses.cbegin(), statuses.cend(),
+                                  expected.cbegin(), expected.cend());
+  }
+
+  { const auto variants = parser.sweep("dummy_prog", split("two --level 7"),
+                                       { "things", "level" });
+    BOOST_REQUIRE_EQUAL(variants.size(), 1);
+    BOOST_CHECK_EQUAL(parser.run_sweep(variants).front(), 70);
+  }
+
+  { // Options that are not named as swept are taken literally:
+    const auto variants = parser.sweep("dummy_prog",
+                                       split("two --things b|c --level 2..3"),
+                                       { "level" });
+    BOOST_REQUIRE_EQUAL(variants.size(), 2);
+    BOOST_CHECK_EQUAL(variants[1]["things"].as<std::string>(), "b|c");
+    BOOST_CHECK_EQUAL(variants[1]["level"].as<int>(), 3);
+  }
+
+  { // Ranges reaching the limits of long long must not overflow:
+    const auto upper = parser.sweep("dummy_prog",
+                                    split("two --things 9223372036854775800..9223372036854775807:4"),
+                                    { "things" });
+    BOOST_REQUIRE_EQUAL(upper.size(), 2);
+    BOOST_CHECK_EQUAL(upper[1]["things"].as<std::string>(), "9223372036854775804");
+
+    const auto lower = parser.sweep("dummy_prog",
+                                    split("two --things -9223372036854775801..-9223372036854775808:3"),
+                                    { "things" });
+    BOOST_REQUIRE_EQUAL(lower.size(), 3);
+    BOOST_CHECK_EQUAL(lower[2]["things"].as<std::string>(), "-9223372036854775807");
+  }
+}
+
+
+void TestModeAPI::warm_up() {
+  BoostPO::options_description warm_opts("mode warm"), cold_opts("mode cold");
+  auto warm = std::make_shared<MHwarm>(), fragile = std::make_shared<MHwarm>();
+
+  warm_opts.add_options()
+    ("index", BoostPO::value<std::string>());
+
+  BpoModes parser;
+  parser.add("warm", warm_opts, warm)
+        .add("cold", cold_opts)
+        .add("fragile", cold_opts, fragile);
+
+  { const auto vm = parser.parse("dummy_prog", split("cold"));
+    BOOST_CHECK(!warm->warmed);
+    BOOST_CHECK_EQUAL(parser.run_subcommand(vm), 0);
+  }
+
+  { const auto vm = parser.parse("dummy_prog", split("warm --index big.idx"));
+    BOOST_CHECK_EQUAL(parser.run_subcommand(vm), 1);
+    BOOST_CHECK(warm->warm_thread != std::this_thread::get_id());
+  }
+
+  { // Repeated parses share the handler's single warm-up:
+    const auto vm1 = parser.parse("dummy_prog", split("warm --index a.idx"));
+    const auto vm2 = parser.parse("dummy_prog", split("warm --index b.idx"));
+    BOOST_CHECK_EQUAL(parser.run_subcommand(vm1), 1);
+    BOOST_CHECK_EQUAL(warm->n_warm_ups, 1);
+  }
+
+  fragile->fail = true;
+  { const auto vm1 = parser.parse("dummy_prog", split("fragile"));
+    const auto vm2 = parser.parse("dummy_prog", split("fragile"));
+    BOOST_CHECK_THROW(parser.run_subcommand(vm1), std::runtime_error);
+    BOOST_CHECK_THROW(parser.run_subcommand(vm2), std::runtime_error);
+    BOOST_CHECK_EQUAL(fragile->n_warm_ups, 1);
+  }
+}
+
+
   }   // namespace testing
 }   // namespace bpomodes